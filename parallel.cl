@@ -1,36 +1,54 @@
 
 
-__kernel void parallelGraphicsEngine(
-    __global uchar4 *pixels,           
-    __global float2 *satellitePositions, 
-    __global float4 *satelliteColors,   
-    int windowWidth,                   
-    int windowHeight,                  
-    int satelliteCount,                
-    int mousePosX,                     
-    int mousePosY,                     
-    float blackHoleRadius,             
-    float satelliteRadius              
-)
-{
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
 
-    int pixelX = get_global_id(0);
-    int pixelY = get_global_id(1);
+// Longest satellite list a tile can stage in local memory. Tiles with more
+// satellites fall back to looping over all of them.
+#ifndef TILE_LIST_CAPACITY
+#define TILE_LIST_CAPACITY 256
+#endif
 
-    int i = pixelX + windowWidth * pixelY;
+#define BIN_GROUP_SIZE 256
 
-    // Initialize pixel color
-    float4 renderColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+// Satellites a work-group of parallelGraphicsEngineStaged loads into local
+// memory at a time, and pixels each of its work-items renders
+#ifndef SATELLITE_CHUNK
+#define SATELLITE_CHUNK 64
+#endif
 
+#ifndef PIXELS_PER_ITEM
+#define PIXELS_PER_ITEM 4
+#endif
 
-    float2 positionToBlackHole = (float2)(pixelX - mousePosX, pixelY - mousePosY);
-    float distToBlackHoleSquared = dot(positionToBlackHole, positionToBlackHole);
+// Specialized builds get the scene constants with -D and the render
+// kernels use them instead of their arguments, so the compiler can fold
+// them and unroll the satellite loops.
+#ifdef SPECIALIZED
+#define SPECIALIZE_SCENE() \
+    windowWidth = SPECIALIZED_WINDOW_WIDTH; \
+    windowHeight = SPECIALIZED_WINDOW_HEIGHT; \
+    satelliteCount = SPECIALIZED_SATELLITE_COUNT; \
+    blackHoleRadius = SPECIALIZED_BLACK_HOLE_RADIUS; \
+    satelliteRadius = SPECIALIZED_SATELLITE_RADIUS
+#else
+#define SPECIALIZE_SCENE()
+#endif
 
-    if (distToBlackHoleSquared < blackHoleRadius * blackHoleRadius) {
-        // Black hole pixels are black
-        pixels[i] = (uchar4)(0, 0, 0, 255);
-        return;
-    }
+
+// Colors a pixel outside the black hole by looping over every satellite
+inline float4 shadeAllSatellites(
+    int pixelX,
+    int pixelY,
+    __global float2 *satellitePositions,
+    __global float4 *satelliteColors,
+    int satelliteCount,
+    float satelliteRadius
+)
+{
+    // Initialize pixel color
+    float4 renderColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
 
     float shortestDistance = INFINITY;
     float weights = 0.0f;
@@ -77,10 +95,645 @@ __kernel void parallelGraphicsEngine(
         }
     }
 
+    return renderColor;
+}
+
+// Convert color to 8-bit
+inline uchar4 toPixel(float4 renderColor)
+{
+    return (uchar4)((uchar)(clamp(renderColor.x, 0.0f, 1.0f) * 255.0f),
+                    (uchar)(clamp(renderColor.y, 0.0f, 1.0f) * 255.0f),
+                    (uchar)(clamp(renderColor.z, 0.0f, 1.0f) * 255.0f),
+                    255);
+}
+
+inline int insideBlackHole(int pixelX, int pixelY, int mousePosX, int mousePosY, float blackHoleRadius)
+{
+    float2 positionToBlackHole = (float2)(pixelX - mousePosX, pixelY - mousePosY);
+    float distToBlackHoleSquared = dot(positionToBlackHole, positionToBlackHole);
+    return distToBlackHoleSquared < blackHoleRadius * blackHoleRadius;
+}
+
+
+__kernel void parallelGraphicsEngine(
+    __global uchar4 *pixels,           
+    __global float2 *satellitePositions, 
+    __global float4 *satelliteColors,   
+    int windowWidth,                   
+    int windowHeight,                  
+    int satelliteCount,                
+    int mousePosX,                     
+    int mousePosY,                     
+    float blackHoleRadius,             
+    float satelliteRadius              
+)
+{
+    SPECIALIZE_SCENE();
+
+    int pixelX = get_global_id(0);
+    int pixelY = get_global_id(1);
+    if (pixelX >= windowWidth || pixelY >= windowHeight) {
+        return;
+    }
+
+    int i = pixelX + windowWidth * pixelY;
+
+    if (insideBlackHole(pixelX, pixelY, mousePosX, mousePosY, blackHoleRadius)) {
+        // Black hole pixels are black
+        pixels[i] = (uchar4)(0, 0, 0, 255);
+        return;
+    }
+
+    pixels[i] = toPixel(shadeAllSatellites(pixelX, pixelY, satellitePositions, satelliteColors,
+                                           satelliteCount, satelliteRadius));
+}
+
+
+// Single pass version of parallelGraphicsEngine. The blend is
+// sum(color * weight) / sum(weight), so the weighted color sum can be
+// accumulated together with the weights and normalized once at the end
+// instead of computing every distance again in a second loop.
+__kernel void parallelGraphicsEngineFused(
+    __global uchar4 *pixels,
+    __global float2 *satellitePositions,
+    __global float4 *satelliteColors,
+    int windowWidth,
+    int windowHeight,
+    int satelliteCount,
+    int mousePosX,
+    int mousePosY,
+    float blackHoleRadius,
+    float satelliteRadius
+)
+{
+    SPECIALIZE_SCENE();
+
+    int pixelX = get_global_id(0);
+    int pixelY = get_global_id(1);
+    if (pixelX >= windowWidth || pixelY >= windowHeight) {
+        return;
+    }
+
+    int i = pixelX + windowWidth * pixelY;
+
+    if (insideBlackHole(pixelX, pixelY, mousePosX, mousePosY, blackHoleRadius)) {
+        pixels[i] = (uchar4)(0, 0, 0, 255);
+        return;
+    }
+
+    float4 nearestColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    float4 weightedColors = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    float shortestDistance = INFINITY;
+    float weights = 0.0f;
+
+    for (int j = 0; j < satelliteCount; ++j) {
+        float2 satellitePos = satellitePositions[j];
+        float2 difference = (float2)(pixelX - satellitePos.x, pixelY - satellitePos.y);
+        float dist2 = dot(difference, difference);
+
+        // Same test as the reference so the satellite edges match exactly
+        if (sqrt(dist2) < satelliteRadius) {
+            // Pixel is inside a satellite
+            pixels[i] = (uchar4)(255, 255, 255, 255);
+            return;
+        }
+
+        float4 color = satelliteColors[j];
+        float weight = 1.0f / (dist2 * dist2);
+        weights += weight;
+        weightedColors += color * weight;
+
+        if (dist2 < shortestDistance) {
+            shortestDistance = dist2;
+            nearestColor = color;
+        }
+    }
+
+    float4 renderColor = nearestColor + (weightedColors / weights) * 3.0f;
+    pixels[i] = toPixel(renderColor);
+}
+
+
+// parallelGraphicsEngine with the satellites staged through local memory.
+// The work-group loads SATELLITE_CHUNK satellites at a time and every
+// work-item uses them for PIXELS_PER_ITEM pixels, so each satellite is read
+// from global memory once per work-group and chunk instead of once per
+// pixel. A work-item's pixels are a work-group width apart on the same row
+// so the pixel writes stay coalesced.
+__kernel void parallelGraphicsEngineStaged(
+    __global uchar4 *pixels,
+    __global float2 *satellitePositions,
+    __global float4 *satelliteColors,
+    int windowWidth,
+    int windowHeight,
+    int satelliteCount,
+    int mousePosX,
+    int mousePosY,
+    float blackHoleRadius,
+    float satelliteRadius
+)
+{
+    SPECIALIZE_SCENE();
+
+    __local float2 chunkPositions[SATELLITE_CHUNK];
+    __local float4 chunkColors[SATELLITE_CHUNK];
+
+    int localWidth = get_local_size(0);
+    int groupSize = localWidth * get_local_size(1);
+    int lid = get_local_id(1) * localWidth + get_local_id(0);
+    int firstX = get_group_id(0) * localWidth * PIXELS_PER_ITEM + get_local_id(0);
+    int pixelY = get_global_id(1);
+
+    float4 renderColor[PIXELS_PER_ITEM];
+    float shortestDistance[PIXELS_PER_ITEM];
+    float weights[PIXELS_PER_ITEM];
+    int shade[PIXELS_PER_ITEM];
+    int hitsSatellite[PIXELS_PER_ITEM];
+
+    for (int p = 0; p < PIXELS_PER_ITEM; ++p) {
+        int pixelX = firstX + p * localWidth;
+        renderColor[p] = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+        shortestDistance[p] = INFINITY;
+        weights[p] = 0.0f;
+        hitsSatellite[p] = 0;
+        shade[p] = pixelX < windowWidth && pixelY < windowHeight;
+        if (shade[p] && insideBlackHole(pixelX, pixelY, mousePosX, mousePosY, blackHoleRadius)) {
+            pixels[pixelX + windowWidth * pixelY] = (uchar4)(0, 0, 0, 255);
+            shade[p] = 0;
+        }
+    }
+
+    // Work-items can't leave early, every one of them has to reach the
+    // barriers of both loops
+
+    // Find closest satellite
+    for (int base = 0; base < satelliteCount; base += SATELLITE_CHUNK) {
+        int chunkCount = min(SATELLITE_CHUNK, satelliteCount - base);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int k = lid; k < chunkCount; k += groupSize) {
+            chunkPositions[k] = satellitePositions[base + k];
+            chunkColors[k] = satelliteColors[base + k];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int j = 0; j < chunkCount; ++j) {
+            float2 satellitePos = chunkPositions[j];
+            for (int p = 0; p < PIXELS_PER_ITEM; ++p) {
+                if (!shade[p] || hitsSatellite[p]) {
+                    continue;
+                }
+                float2 difference = (float2)(firstX + p * localWidth - satellitePos.x, pixelY - satellitePos.y);
+                float distance = length(difference);
+
+                if (distance < satelliteRadius) {
+                    // Pixel is inside a satellite
+                    renderColor[p].x = 1.0f;
+                    renderColor[p].y = 1.0f;
+                    renderColor[p].z = 1.0f;
+                    hitsSatellite[p] = 1;
+                } else {
+                    weights[p] += 1.0f / (distance * distance * distance * distance);
+                    if (distance < shortestDistance[p]) {
+                        shortestDistance[p] = distance;
+                        renderColor[p] = chunkColors[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // Weighted blending for the pixels that didn't hit a satellite
+    for (int base = 0; base < satelliteCount; base += SATELLITE_CHUNK) {
+        int chunkCount = min(SATELLITE_CHUNK, satelliteCount - base);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int k = lid; k < chunkCount; k += groupSize) {
+            chunkPositions[k] = satellitePositions[base + k];
+            chunkColors[k] = satelliteColors[base + k];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+
+        for (int j = 0; j < chunkCount; ++j) {
+            float2 satellitePos = chunkPositions[j];
+            float4 satelliteColor = chunkColors[j];
+            for (int p = 0; p < PIXELS_PER_ITEM; ++p) {
+                if (!shade[p] || hitsSatellite[p]) {
+                    continue;
+                }
+                float2 difference = (float2)(firstX + p * localWidth - satellitePos.x, pixelY - satellitePos.y);
+                float dist2 = dot(difference, difference);
+                float weight = 1.0f / (dist2 * dist2);
+
+                renderColor[p].x += (satelliteColor.x * weight / weights[p]) * 3.0f;
+                renderColor[p].y += (satelliteColor.y * weight / weights[p]) * 3.0f;
+                renderColor[p].z += (satelliteColor.z * weight / weights[p]) * 3.0f;
+            }
+        }
+    }
+
+    for (int p = 0; p < PIXELS_PER_ITEM; ++p) {
+        if (shade[p]) {
+            pixels[firstX + p * localWidth + windowWidth * pixelY] = toPixel(renderColor[p]);
+        }
+    }
+}
+
+
+// Tile-based culling
+//
+// binSatellites runs one work-group per TILE_SIZE x TILE_SIZE tile of the
+// window and lists the satellites the tile needs individually:
+//  - near satellites, closer to the tile than farFieldDistance. They can
+//    hit pixels and their weights are evaluated exactly per pixel.
+//  - nearest candidates that are otherwise far. A satellite can only be
+//    the nearest one for some pixel if its distance to the tile is at most
+//    the smallest farthest-pixel distance of all satellites.
+// Far candidates are stored as ~index. Every far satellite is also added
+// to an aggregate of color * weight and weight at the four tile corners,
+// and the render kernel interpolates that bilinearly. With the weight
+// 1 / d^4 and a tile span s, the interpolation error of a single far
+// satellite's weight is at most about 3 * s^2 / d^2 relative, i.e. about
+// 1% for 16 pixel tiles at 256 pixels, and the far field is only a part of
+// the blended color.
+
+// Squared distances from a point to the nearest and the farthest pixel of a tile
+inline float2 tileDistancesSquared(float2 position, float2 tileMin, float2 tileMax)
+{
+    float2 nearest = clamp(position, tileMin, tileMax);
+    float2 farthest = select(tileMin, tileMax, position < (tileMin + tileMax) * 0.5f);
+    float2 toNearest = position - nearest;
+    float2 toFarthest = position - farthest;
+    return (float2)(dot(toNearest, toNearest), dot(toFarthest, toFarthest));
+}
+
+__kernel __attribute__((reqd_work_group_size(BIN_GROUP_SIZE, 1, 1)))
+void binSatellites(
+    __global float2 *satellitePositions,
+    __global float4 *satelliteColors,
+    int satelliteCount,
+    int windowWidth,
+    float farFieldDistance,
+    __global int *tileCounts,
+    __global int *tileIndices,
+    __global float4 *tileFarField
+)
+{
+    __local float reduction[BIN_GROUP_SIZE];
+    __local int listCount;
+
+    int tile = get_group_id(0);
+    int lid = get_local_id(0);
+    int tilesX = (windowWidth + TILE_SIZE - 1) / TILE_SIZE;
+    float2 tileMin = (float2)((tile % tilesX) * TILE_SIZE, (tile / tilesX) * TILE_SIZE);
+    float2 tileMax = tileMin + (float2)(TILE_SIZE - 1, TILE_SIZE - 1);
+
+    // Smallest farthest-pixel distance over all satellites
+    float candidateLimit = INFINITY;
+    for (int j = lid; j < satelliteCount; j += BIN_GROUP_SIZE) {
+        candidateLimit = fmin(candidateLimit, tileDistancesSquared(satellitePositions[j], tileMin, tileMax).y);
+    }
+    reduction[lid] = candidateLimit;
+    if (lid == 0) {
+        listCount = 0;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int stride = BIN_GROUP_SIZE / 2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            reduction[lid] = fmin(reduction[lid], reduction[lid + stride]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    candidateLimit = reduction[0];
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    float2 corners[4] = {
+        tileMin,
+        (float2)(tileMax.x, tileMin.y),
+        (float2)(tileMin.x, tileMax.y),
+        tileMax
+    };
+    // Color * weight and weight of the far satellites at each corner
+    float farField[16];
+    for (int k = 0; k < 16; ++k) {
+        farField[k] = 0.0f;
+    }
+
+    float farSquared = farFieldDistance * farFieldDistance;
+    for (int j = lid; j < satelliteCount; j += BIN_GROUP_SIZE) {
+        float2 position = satellitePositions[j];
+        float nearestSquared = tileDistancesSquared(position, tileMin, tileMax).x;
+        int near = nearestSquared < farSquared;
+
+        if (near || nearestSquared <= candidateLimit) {
+            int slot = atomic_inc(&listCount);
+            if (slot < TILE_LIST_CAPACITY) {
+                tileIndices[tile * TILE_LIST_CAPACITY + slot] = near ? j : ~j;
+            }
+        }
+
+        if (!near) {
+            float4 color = satelliteColors[j];
+            for (int c = 0; c < 4; ++c) {
+                float2 difference = corners[c] - position;
+                float dist2 = dot(difference, difference);
+                float weight = 1.0f / (dist2 * dist2);
+                farField[4 * c + 0] += color.x * weight;
+                farField[4 * c + 1] += color.y * weight;
+                farField[4 * c + 2] += color.z * weight;
+                farField[4 * c + 3] += weight;
+            }
+        }
+    }
+
+    // Sum the far field over the work-group one value at a time
+    for (int k = 0; k < 16; ++k) {
+        reduction[lid] = farField[k];
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int stride = BIN_GROUP_SIZE / 2; stride > 0; stride >>= 1) {
+            if (lid < stride) {
+                reduction[lid] += reduction[lid + stride];
+            }
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (lid == 0) {
+            ((__global float *)&tileFarField[tile * 4])[k] = reduction[0];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0) {
+        tileCounts[tile] = listCount;
+    }
+}
+
+// Renders one tile per work-group from the list made by binSatellites. The
+// list is staged in local memory once and shared by the whole tile.
+__kernel __attribute__((reqd_work_group_size(TILE_SIZE, TILE_SIZE, 1)))
+void parallelGraphicsEngineTiled(
+    __global uchar4 *pixels,
+    __global float2 *satellitePositions,
+    __global float4 *satelliteColors,
+    int windowWidth,
+    int windowHeight,
+    int satelliteCount,
+    int mousePosX,
+    int mousePosY,
+    float blackHoleRadius,
+    float satelliteRadius,
+    __global int *tileCounts,
+    __global int *tileIndices,
+    __global float4 *tileFarField
+)
+{
+    SPECIALIZE_SCENE();
+
+    __local float2 listPositions[TILE_LIST_CAPACITY];
+    __local float4 listColors[TILE_LIST_CAPACITY];
+    __local int listNear[TILE_LIST_CAPACITY];
+
+    int pixelX = get_global_id(0);
+    int pixelY = get_global_id(1);
+    int lid = get_local_id(1) * TILE_SIZE + get_local_id(0);
+    int tilesX = (windowWidth + TILE_SIZE - 1) / TILE_SIZE;
+    int tile = get_group_id(1) * tilesX + get_group_id(0);
+    int count = tileCounts[tile];
+
+    if (count <= TILE_LIST_CAPACITY) {
+        for (int k = lid; k < count; k += TILE_SIZE * TILE_SIZE) {
+            int entry = tileIndices[tile * TILE_LIST_CAPACITY + k];
+            int j = entry >= 0 ? entry : ~entry;
+            listPositions[k] = satellitePositions[j];
+            listColors[k] = satelliteColors[j];
+            listNear[k] = entry >= 0;
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (pixelX >= windowWidth || pixelY >= windowHeight) {
+        return;
+    }
+
+    int i = pixelX + windowWidth * pixelY;
+
+    if (insideBlackHole(pixelX, pixelY, mousePosX, mousePosY, blackHoleRadius)) {
+        pixels[i] = (uchar4)(0, 0, 0, 255);
+        return;
+    }
+
+    // The list didn't fit, this tile needs every satellite
+    if (count > TILE_LIST_CAPACITY) {
+        pixels[i] = toPixel(shadeAllSatellites(pixelX, pixelY, satellitePositions, satelliteColors,
+                                               satelliteCount, satelliteRadius));
+        return;
+    }
+
+    float4 renderColor = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    float shortestDistance = INFINITY;
+    float weights = 0.0f;
+    int hitsSatellite = 0;
+
+    // Find closest satellite. Far candidates only take part in the search,
+    // their weight comes from the far field.
+    for (int k = 0; k < count; ++k) {
+        float2 difference = (float2)(pixelX - listPositions[k].x, pixelY - listPositions[k].y);
+        float distance = length(difference);
+
+        if (listNear[k]) {
+            if (distance < satelliteRadius) {
+                renderColor.x = 1.0f;
+                renderColor.y = 1.0f;
+                renderColor.z = 1.0f;
+                hitsSatellite = 1;
+                break;
+            }
+            weights += 1.0f / (distance * distance * distance * distance);
+        }
+        if (distance < shortestDistance) {
+            shortestDistance = distance;
+            renderColor = listColors[k];
+        }
+    }
+
+    if (!hitsSatellite) {
+        float u = (pixelX % TILE_SIZE) / (float)(TILE_SIZE - 1);
+        float v = (pixelY % TILE_SIZE) / (float)(TILE_SIZE - 1);
+        __global float4 *corners = &tileFarField[tile * 4];
+        float4 farField = mix(mix(corners[0], corners[1], u), mix(corners[2], corners[3], u), v);
+        weights += farField.w;
+
+        for (int k = 0; k < count; ++k) {
+            if (!listNear[k]) {
+                continue;
+            }
+            float2 difference = (float2)(pixelX - listPositions[k].x, pixelY - listPositions[k].y);
+            float dist2 = dot(difference, difference);
+            float weight = 1.0f / (dist2 * dist2);
+
+            renderColor.x += (listColors[k].x * weight / weights) * 3.0f;
+            renderColor.y += (listColors[k].y * weight / weights) * 3.0f;
+            renderColor.z += (listColors[k].z * weight / weights) * 3.0f;
+        }
+        renderColor.x += (farField.x / weights) * 3.0f;
+        renderColor.y += (farField.y / weights) * 3.0f;
+        renderColor.z += (farField.z / weights) * 3.0f;
+    }
+
+    pixels[i] = toPixel(renderColor);
+}
+
+
+// The physics kernel has to round like the host engines, no contraction
+// into fma when it isn't asked for
+#pragma OPENCL FP_CONTRACT OFF
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+typedef double real;
+
+#define REAL_FROM_FLOAT(f) ((double)(f))
+#define REAL_TO_FLOAT(r) ((float)(r))
+#define REAL_ADD(a, b) ((a) + (b))
+#define REAL_SUB(a, b) ((a) - (b))
+#define REAL_MUL(a, b) ((a) * (b))
+#define REAL_DIV(a, b) ((a) / (b))
+#define REAL_SQRT(a) sqrt(a)
+
+#else
+
+// Double-float emulation for devices without fp64. A value is the unevaluated
+// sum hi + lo of two floats, which gives about 48 bits of mantissa. The
+// error-free transforms below rely on exact float rounding, so this must
+// not be built with -cl-fast-relaxed-math.
+typedef float2 real;
+
+inline float2 twoSum(float a, float b) {
+    float s = a + b;
+    float v = s - a;
+    float e = (a - (s - v)) + (b - v);
+    return (float2)(s, e);
+}
+
+inline float2 quickTwoSum(float a, float b) {
+    float s = a + b;
+    float e = b - (s - a);
+    return (float2)(s, e);
+}
+
+inline float2 dfAdd(float2 a, float2 b) {
+    float2 s = twoSum(a.x, b.x);
+    float2 t = twoSum(a.y, b.y);
+    s.y += t.x;
+    s = quickTwoSum(s.x, s.y);
+    s.y += t.y;
+    return quickTwoSum(s.x, s.y);
+}
+
+inline float2 dfSub(float2 a, float2 b) {
+    return dfAdd(a, -b);
+}
+
+inline float2 dfMul(float2 a, float2 b) {
+    float p = a.x * b.x;
+    float e = fma(a.x, b.x, -p);
+    e += a.x * b.y + a.y * b.x;
+    return quickTwoSum(p, e);
+}
+
+inline float2 dfDiv(float2 a, float2 b) {
+    float q1 = a.x / b.x;
+    float2 r = dfSub(a, dfMul(b, (float2)(q1, 0.0f)));
+    float q2 = r.x / b.x;
+    r = dfSub(r, dfMul(b, (float2)(q2, 0.0f)));
+    float q3 = r.x / b.x;
+    return dfAdd(quickTwoSum(q1, q2), (float2)(q3, 0.0f));
+}
+
+inline float2 dfSqrt(float2 a) {
+    if (a.x <= 0.0f) {
+        return (float2)(0.0f, 0.0f);
+    }
+    // One Newton step from the float estimate (Karp's method)
+    float x = rsqrt(a.x);
+    float ax = a.x * x;
+    float2 axSquared = dfMul((float2)(ax, 0.0f), (float2)(ax, 0.0f));
+    float correction = dfSub(a, axSquared).x * (x * 0.5f);
+    return dfAdd((float2)(ax, 0.0f), (float2)(correction, 0.0f));
+}
+
+#define REAL_FROM_FLOAT(f) ((float2)((f), 0.0f))
+#define REAL_TO_FLOAT(r) ((r).x + (r).y)
+#define REAL_ADD(a, b) dfAdd(a, b)
+#define REAL_SUB(a, b) dfSub(a, b)
+#define REAL_MUL(a, b) dfMul(a, b)
+#define REAL_DIV(a, b) dfDiv(a, b)
+#define REAL_SQRT(a) dfSqrt(a)
+
+#endif
+
+
+// Moves the satellites like the host physics engines do, one work-item per
+// satellite. The state stays on the device between frames as four arrays
+// (x, y, vx, vy) of satelliteCount values each. The positions are also
+// written as floats into the buffer the render kernel reads.
+__kernel void parallelPhysicsEngine(
+    __global real *state,
+    __global float2 *satellitePositions,
+    int satelliteCount,
+    int physicsUpdates,
+    float gravity,
+    int deltaTime,
+    int mousePosX,
+    int mousePosY
+)
+{
+    int i = get_global_id(0);
+    if (i >= satelliteCount) {
+        return;
+    }
+
+    real x = state[i];
+    real y = state[satelliteCount + i];
+    real vx = state[2 * satelliteCount + i];
+    real vy = state[3 * satelliteCount + i];
+
+    real holeX = REAL_FROM_FLOAT((float)mousePosX);
+    real holeY = REAL_FROM_FLOAT((float)mousePosY);
+    real g = REAL_FROM_FLOAT(gravity);
+    real dt = REAL_FROM_FLOAT((float)deltaTime);
+#ifdef cl_khr_fp64
+    real updates = (double)physicsUpdates;
+#else
+    real updates = (float2)((float)physicsUpdates, (float)(physicsUpdates - (int)(float)physicsUpdates));
+#endif
+
+    for (int physicsUpdateIndex = 0; physicsUpdateIndex < physicsUpdates; ++physicsUpdateIndex) {
+
+        // Distance to the black hole
+        real toHoleX = REAL_SUB(x, holeX);
+        real toHoleY = REAL_SUB(y, holeY);
+        real distSquared = REAL_ADD(REAL_MUL(toHoleX, toHoleX), REAL_MUL(toHoleY, toHoleY));
+        real dist = REAL_SQRT(distSquared);
+
+        // Gravity force
+        real directionX = REAL_DIV(toHoleX, dist);
+        real directionY = REAL_DIV(toHoleY, dist);
+        real accumulation = REAL_DIV(g, distSquared);
+
+        // Update velocity based on force
+        vx = REAL_SUB(vx, REAL_DIV(REAL_MUL(REAL_MUL(accumulation, directionX), dt), updates));
+        vy = REAL_SUB(vy, REAL_DIV(REAL_MUL(REAL_MUL(accumulation, directionY), dt), updates));
+
+        // Update position based on velocity
+        x = REAL_ADD(x, REAL_DIV(REAL_MUL(vx, dt), updates));
+        y = REAL_ADD(y, REAL_DIV(REAL_MUL(vy, dt), updates));
+    }
 
-    // Convert color to 8-bit and write to output
-    pixels[i] = (uchar4)((uchar)(clamp(renderColor.x, 0.0f, 1.0f) * 255.0f),
-                         (uchar)(clamp(renderColor.y, 0.0f, 1.0f) * 255.0f),
-                         (uchar)(clamp(renderColor.z, 0.0f, 1.0f) * 255.0f),
-                         255);
-}
\ No newline at end of file
+    // The host keeps positions and velocities as floats between frames,
+    // round the same way so both start every frame from the same state
+    float2 position = (float2)(REAL_TO_FLOAT(x), REAL_TO_FLOAT(y));
+    state[i] = REAL_FROM_FLOAT(position.x);
+    state[satelliteCount + i] = REAL_FROM_FLOAT(position.y);
+    state[2 * satelliteCount + i] = REAL_FROM_FLOAT(REAL_TO_FLOAT(vx));
+    state[3 * satelliteCount + i] = REAL_FROM_FLOAT(REAL_TO_FLOAT(vy));
+    satellitePositions[i] = position;
+}
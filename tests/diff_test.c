@@ -0,0 +1,110 @@
+// Checks diffFrames() on frames with known differences, and the AVX2 row
+// diff against the scalar one for row lengths that leave every tail size.
+#define main parallelMain
+#include "../parallel.c"
+#undef main
+
+#define TEST_TOLERANCE 16
+
+int failures = 0;
+
+void expect(int condition, const char* what) {
+    if (!condition) {
+        printf("FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+int sameHeat(color_u8 a, color_u8 b) {
+    return a.blue == b.blue && a.green == b.green && a.red == b.red && a.reserved == b.reserved;
+}
+
+int main() {
+
+    // 37 is not a multiple of 8, so the scalar tail of each row runs too
+    config.windowWidth = 37;
+    config.windowHeight = 5;
+    detectCpuFeatures();
+
+    color_u8* a = malloc(sizeof(color_u8) * SIZE);
+    color_u8* b = malloc(sizeof(color_u8) * SIZE);
+    color_u8* heat = malloc(sizeof(color_u8) * SIZE);
+    if (!a || !b || !heat) {
+        printf("Error allocating the test frames\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < SIZE; ++i) {
+        a[i] = (color_u8){.blue = (uint8_t)(i % 200), .green = 100, .red = 50, .reserved = 255};
+    }
+
+    frameDiff diff;
+    diffFrames(a, a, heat, TEST_TOLERANCE, &diff);
+    expect(diffMaxDeviation(&diff) == 0, "identical frames have no error");
+    expect(diff.squaredError[0] + diff.squaredError[1] + diff.squaredError[2] == 0,
+           "identical frames have no squared error");
+    expect(diff.histogram[0] == (unsigned int)SIZE, "identical frames count every pixel in bin 0");
+    expect(sameHeat(heat[SIZE - 1], heatPixel(0, TEST_TOLERANCE)), "identical frames give a black heatmap");
+
+    // Blue 3 up everywhere, red 20 down on every third pixel
+    int redPixels = 0;
+    for (int i = 0; i < SIZE; ++i) {
+        b[i] = a[i];
+        b[i].blue += 3;
+        if (i % 3 == 0) {
+            b[i].red -= 20;
+            ++redPixels;
+        }
+    }
+    diffFrames(a, b, heat, TEST_TOLERANCE, &diff);
+    expect(diff.maxError[0] == 3 && diff.maxError[1] == 0 && diff.maxError[2] == 20, "maximum error per channel");
+    expect(diff.squaredError[0] == 9 * (Uint64)SIZE, "blue squared error");
+    expect(diff.squaredError[1] == 0, "green squared error");
+    expect(diff.squaredError[2] == 400 * (Uint64)redPixels, "red squared error");
+    expect(diff.histogram[3] == (unsigned int)(SIZE - redPixels) && diff.histogram[20] == (unsigned int)redPixels,
+           "histogram of the largest differences");
+    expect(diffPixelsOver(&diff, TEST_TOLERANCE) == (unsigned int)redPixels, "pixels over the tolerance");
+    int heatOk = 1;
+    for (int i = 0; i < SIZE; ++i) {
+        color_u8 expected = i % 3 == 0 ? (color_u8){.blue = 0, .green = 0, .red = 255, .reserved = 255}
+                                       : (color_u8){.blue = 24, .green = 24, .red = 24, .reserved = 255};
+        heatOk &= sameHeat(heat[i], expected);
+    }
+    expect(heatOk, "heatmap is red over the tolerance and 8x gray under it");
+
+#ifdef X86_SIMD
+    if (cpuHasAvx2) {
+        srand(7);
+        for (int i = 0; i < SIZE; ++i) {
+            a[i] = (color_u8){.blue = rand(), .green = rand(), .red = rand(), .reserved = rand()};
+            b[i] = (color_u8){.blue = rand(), .green = rand(), .red = rand(), .reserved = rand()};
+        }
+        color_u8* vectorHeat = malloc(sizeof(color_u8) * SIZE);
+        if (!vectorHeat) {
+            printf("Error allocating the test heatmap\n");
+            exit(EXIT_FAILURE);
+        }
+        for (int count = 0; count <= SIZE; count += count < 40 ? 1 : 29) {
+            frameDiff scalar;
+            frameDiff vector;
+            memset(&scalar, 0, sizeof(frameDiff));
+            memset(&vector, 0, sizeof(frameDiff));
+            diffRowScalar(a, b, heat, count, TEST_TOLERANCE, &scalar);
+            diffRowAvx2(a, b, vectorHeat, count, TEST_TOLERANCE, &vector);
+            if (memcmp(&scalar, &vector, sizeof(frameDiff)) != 0 ||
+                memcmp(heat, vectorHeat, sizeof(color_u8) * count) != 0) {
+                printf("FAILED: AVX2 and scalar row diffs differ for %d pixels\n", count);
+                ++failures;
+            }
+        }
+        free(vectorHeat);
+    } else {
+        printf("AVX2 row diff skipped, not supported by the CPU\n");
+    }
+#endif
+
+    free(a);
+    free(b);
+    free(heat);
+    printf("%s\n", failures ? "Frame diff test failed" : "Frame diff test passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
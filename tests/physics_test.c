@@ -0,0 +1,76 @@
+// Advances a seeded scene for a few frames with every lane group width the
+// CPU supports and compares the satellites bit for bit with
+// sequentialPhysicsEngine(). The satellite count is not a multiple of any
+// width, so the padding lanes are covered too.
+#define main parallelMain
+#include "../parallel.c"
+#undef main
+
+#define TEST_FRAMES 3
+
+typedef struct {
+    const char* name;
+    laneGroupFunction function;
+    int lanes;
+    int supported;
+} laneGroupCase;
+
+int main() {
+
+    config.satelliteCount = 61;
+    config.physicsUpdatesPerFrame = 2000;
+    fixedInit(5);
+    detectCpuFeatures();
+    mousePosX = HORIZONTAL_CENTER;
+    mousePosY = VERTICAL_CENTER;
+
+    laneGroupCase cases[] = {
+        {"scalar", advanceLaneGroupScalar, 1, 1},
+#ifdef X86_SIMD
+        {"AVX2", advanceLaneGroupAvx2, 4, cpuHasAvx2},
+        {"AVX-512", advanceLaneGroupAvx512, 8, cpuHasAvx512},
+#endif
+    };
+
+    satellite* start = malloc(sizeof(satellite) * SATELLITE_COUNT);
+    if (!start) {
+        printf("Error allocating the start satellites\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(start, satellites, sizeof(satellite) * SATELLITE_COUNT);
+
+    int failures = 0;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        if (!cases[c].supported) {
+            printf("%s: skipped, not supported by the CPU\n", cases[c].name);
+            continue;
+        }
+
+        // initPhysics pads the state to the widest supported width, which
+        // is a multiple of every narrower one
+        memcpy(satellites, start, sizeof(satellite) * SATELLITE_COUNT);
+        initPhysics();
+        advanceLaneGroup = cases[c].function;
+        integratorLaneGroup = cases[c].function;
+        physicsLanes = cases[c].lanes;
+
+        int mismatches = 0;
+        for (int frame = 0; frame < TEST_FRAMES; ++frame) {
+            memcpy(backupSatelites, satellites, sizeof(satellite) * SATELLITE_COUNT);
+            sequentialPhysicsEngine(backupSatelites);
+            parallelPhysicsEngine();
+            for (int i = 0; i < SATELLITE_COUNT; ++i) {
+                if (memcmp(&satellites[i], &backupSatelites[i], sizeof(satellite)) != 0) {
+                    ++mismatches;
+                }
+            }
+        }
+        printf("%s: %d satellite(s) differ from the reference over %d frames\n", cases[c].name, mismatches,
+               TEST_FRAMES);
+        failures += mismatches > 0;
+        destroyPhysics();
+    }
+
+    free(start);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
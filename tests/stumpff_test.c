@@ -0,0 +1,124 @@
+// Checks stumpff() against the closed forms of c2(z) and c3(z), on both
+// sides of the series limit and far enough out to take many doublings,
+// and the vector versions against the scalar one.
+#define main parallelMain
+#include "../parallel.c"
+#undef main
+
+// Relative. c2(1000) is the worst case at 6e-14: 1 - cos(sqrt(z)) is only
+// 0.02 there and the doublings add up.
+#define TEST_TOLERANCE 1e-13
+#define TEST_POINTS 16
+
+int failures = 0;
+
+// Power series, used below |z| = 1 where the closed forms cancel
+void stumpffSeries(double z, double* c2, double* c3) {
+    double term2 = 0.5;
+    double term3 = 1.0 / 6.0;
+    *c2 = 0.0;
+    *c3 = 0.0;
+    for (int k = 0; k < 30; ++k) {
+        *c2 += term2;
+        *c3 += term3;
+        term2 *= -z / ((2 * k + 3) * (2 * k + 4));
+        term3 *= -z / ((2 * k + 4) * (2 * k + 5));
+    }
+}
+
+void stumpffClosedForm(double z, double* c2, double* c3) {
+    if (fabs(z) < 1.0) {
+        stumpffSeries(z, c2, c3);
+    } else if (z > 0.0) {
+        double s = sqrt(z);
+        *c2 = (1.0 - cos(s)) / z;
+        *c3 = (s - sin(s)) / (z * s);
+    } else {
+        double s = sqrt(-z);
+        *c2 = (cosh(s) - 1.0) / -z;
+        *c3 = (sinh(s) - s) / (-z * s);
+    }
+}
+
+void check(const char* name, double z, double value, double expected, double tolerance) {
+    double error = fabs(value - expected) / fabs(expected);
+    if (!(error <= tolerance)) {
+        printf("FAILED: %s(%g) = %.17g, expected %.17g (relative error %.3g)\n", name, z, value, expected, error);
+        ++failures;
+    }
+}
+
+#ifdef X86_SIMD
+TARGET_AVX2 void stumpffAvx2Points(const double* z, double* c2, double* c3) {
+    for (int i = 0; i < TEST_POINTS; i += 4) {
+        __m256d vectorC2;
+        __m256d vectorC3;
+        stumpffAvx2(_mm256_loadu_pd(&z[i]), &vectorC2, &vectorC3);
+        _mm256_storeu_pd(&c2[i], vectorC2);
+        _mm256_storeu_pd(&c3[i], vectorC3);
+    }
+}
+
+TARGET_AVX512 void stumpffAvx512Points(const double* z, double* c2, double* c3) {
+    for (int i = 0; i < TEST_POINTS; i += 8) {
+        __m512d vectorC2;
+        __m512d vectorC3;
+        stumpffAvx512(_mm512_loadu_pd(&z[i]), &vectorC2, &vectorC3);
+        _mm512_storeu_pd(&c2[i], vectorC2);
+        _mm512_storeu_pd(&c3[i], vectorC3);
+    }
+}
+#endif
+
+int main() {
+
+    double c2;
+    double c3;
+    stumpff(0.0, &c2, &c3);
+    check("c2", 0.0, c2, 0.5, 0.0);
+    check("c3", 0.0, c3, 1.0 / 6.0, 0.0);
+
+    // One full turn, sqrt(z) = pi
+    double pi = acos(-1.0);
+    stumpff(pi * pi, &c2, &c3);
+    check("c2", pi * pi, c2, 2.0 / (pi * pi), TEST_TOLERANCE);
+    check("c3", pi * pi, c3, 1.0 / (pi * pi), TEST_TOLERANCE);
+
+    double points[TEST_POINTS] = {0.0,  0.001, -0.001, 0.05,  -0.05, 0.1,  -0.1,   0.5,
+                                  -0.5, 2.0,   -2.0,   30.0, -30.0, 1.0e3, -400.0, 1.0e4};
+    double expected2[TEST_POINTS];
+    double expected3[TEST_POINTS];
+    for (int i = 0; i < TEST_POINTS; ++i) {
+        stumpff(points[i], &c2, &c3);
+        stumpffClosedForm(points[i], &expected2[i], &expected3[i]);
+        check("c2", points[i], c2, expected2[i], TEST_TOLERANCE);
+        check("c3", points[i], c3, expected3[i], TEST_TOLERANCE);
+    }
+
+#ifdef X86_SIMD
+    detectCpuFeatures();
+    double vector2[TEST_POINTS];
+    double vector3[TEST_POINTS];
+    if (cpuHasAvx2) {
+        stumpffAvx2Points(points, vector2, vector3);
+        for (int i = 0; i < TEST_POINTS; ++i) {
+            check("AVX2 c2", points[i], vector2[i], expected2[i], TEST_TOLERANCE);
+            check("AVX2 c3", points[i], vector3[i], expected3[i], TEST_TOLERANCE);
+        }
+    } else {
+        printf("AVX2 Stumpff functions skipped, not supported by the CPU\n");
+    }
+    if (cpuHasAvx512) {
+        stumpffAvx512Points(points, vector2, vector3);
+        for (int i = 0; i < TEST_POINTS; ++i) {
+            check("AVX-512 c2", points[i], vector2[i], expected2[i], TEST_TOLERANCE);
+            check("AVX-512 c3", points[i], vector3[i], expected3[i], TEST_TOLERANCE);
+        }
+    } else {
+        printf("AVX-512 Stumpff functions skipped, not supported by the CPU\n");
+    }
+#endif
+
+    printf("%s\n", failures ? "Stumpff test failed" : "Stumpff test passed");
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}